@@ -10,6 +10,9 @@
 //------------------------------------------------------------------------------
 // Includes
 //------------------------------------------------------------------------------
+#ifndef _WIN32
+#define _XOPEN_SOURCE 700 // realpath() com -std=c23
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
@@ -19,6 +22,17 @@
 #include <SDL3_image/SDL_image.h>
 #include <SDL3_ttf/SDL_ttf.h>
 
+// Mapeamento em memoria do indice de histogramas
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 //------------------------------------------------------------------------------
 // Custom types, structs, constants, etc.
 //------------------------------------------------------------------------------
@@ -32,6 +46,20 @@ enum constants
 
     DEFAULT_H_WINDOW_WIDTH = 540,
     DEFAULT_H_WINDOW_HEIGHT = 580,
+
+    JOB_LANE_IMAGE = 0,         // Worker dos jobs de imagem (equalizar/analisar)
+    JOB_LANE_SAVE = 1,          // Worker dos jobs de salvamento, um de cada vez
+    JOB_LANE_COUNT = 2,
+    JOB_PROGRESS_MAX = 1000,
+    JOB_PROGRESS_BITS = 11,         // Bits de g_jobs.progress ocupados pelo progresso (> JOB_PROGRESS_MAX)
+    JOB_PROGRESS_ID_MASK = 0xFFFFF, // Bits do id do job guardados acima do progresso
+    PROGRESS_REFRESH_MS = 33,   // Intervalo de redesenho da barra de progresso
+
+    INDEX_VERSION = 1,
+    INDEX_PATH_SIZE = 512,          // Caminho UTF-8 terminado em '\0'
+    INDEX_HISTOGRAM_SCALE = 65535,  // Histograma normalizado: soma dos bins ~= INDEX_HISTOGRAM_SCALE
+    INDEX_DEFAULT_NEAREST = 5,
+    INDEX_MAX_NEAREST = 64,
 };
 
 typedef struct MyWindow MyWindow;
@@ -58,6 +86,135 @@ typedef struct {
     bool pressed;
 } Button;
 
+// Tipos de job executados fora da thread principal (loop de eventos da SDL)
+typedef enum JobKind
+{
+    JOB_ANALYZE,    // Analise inicial: converte a entrada para tons de cinza (se preciso) + histograma + estatisticas
+    JOB_EQUALIZE,   // Equaliza a entrada em uma nova superficie + histograma + estatisticas
+    JOB_SAVE,       // Salva a entrada em PNG
+} JobKind;
+
+typedef struct Job Job;
+struct Job
+{
+    JobKind kind;
+    int id;
+    SDL_Surface *input;     // Referencia propria (refcount), liberada na thread principal
+    char filename[256];
+    int lut[256];           // JOB_EQUALIZE: LUT calculada do histograma original em cache
+
+    // Progresso do job (usado pelos workers)
+    int pass;
+    int pass_count;
+
+    // Resultado, preenchido pelo worker e entregue via evento SDL
+    SDL_Surface *output;
+    int histogram[256];
+    float average_intensity;
+    float std_deviation;
+    bool ok;
+    bool cancelled;
+
+    Job *next;              // Lista de resultados nao entregues por evento
+};
+
+// Indice persistente de histogramas/estatisticas (modo linha de comando).
+// Arquivo = IndexHeader + registros IndexRecord de tamanho fixo, ordenados por caminho,
+// em ordem de bytes nativa. A chave de cada registro e caminho + mtime + tamanho.
+static const char INDEX_MAGIC[8] = { 'C', 'V', 'H', 'I', 'S', 'T', 'I', 'X' };
+
+typedef struct IndexHeader IndexHeader;
+struct IndexHeader
+{
+    char magic[8];
+    Uint32 version;
+    Uint32 record_size;
+    Uint64 count;
+    Uint64 reserved;
+};
+
+typedef struct IndexRecord IndexRecord;
+struct IndexRecord
+{
+    char path[INDEX_PATH_SIZE];
+    Sint64 mtime;                   // SDL_Time (ns) da ultima modificacao
+    Uint64 size;                    // Tamanho do arquivo em bytes
+    Uint32 width;
+    Uint32 height;
+    float average_intensity;
+    float std_deviation;
+    Uint16 histogram[256];          // Normalizado para INDEX_HISTOGRAM_SCALE
+};
+
+SDL_COMPILE_TIME_ASSERT(IndexHeader_size, sizeof(IndexHeader) == 32);
+SDL_COMPILE_TIME_ASSERT(IndexRecord_size, sizeof(IndexRecord) == 1056);
+
+typedef struct MappedFile MappedFile;
+struct MappedFile
+{
+    const Uint8 *data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+// Visao somente leitura de um indice mapeado em memoria
+typedef struct ImageIndex ImageIndex;
+struct ImageIndex
+{
+    MappedFile file;
+    const IndexRecord *records;
+    size_t count;
+};
+
+// Identifica uma pasta fisica: dispositivo + inode (POSIX) ou volume + file ID (Windows)
+typedef struct DirectoryId DirectoryId;
+struct DirectoryId
+{
+    Uint64 device;
+    Uint64 file;
+};
+
+// Lista de caminhos candidatos durante a atualizacao do indice
+typedef struct PathList PathList;
+struct PathList
+{
+    char **items;
+    int count;
+    int capacity;
+    DirectoryId *visited;   // Pastas ja percorridas (evita ciclos por links simbolicos)
+    int visited_count;
+    int visited_capacity;
+    bool out_of_memory;     // Unica falha que interrompe a atualizacao do indice
+};
+
+// Cada lane tem um worker proprio e no maximo um job pendente: um job novo
+// substitui o pendente, entao um salvamento nunca espera atras de um job de
+// imagem e dois salvamentos nunca escrevem no mesmo arquivo ao mesmo tempo.
+typedef struct JobLane JobLane;
+struct JobLane
+{
+    SDL_Thread *worker;
+    Job *pending;                       // Protegido por mutex
+};
+
+typedef struct JobSystem JobSystem;
+struct JobSystem
+{
+    JobLane lanes[JOB_LANE_COUNT];
+    SDL_Mutex *mutex;
+    SDL_Condition *condition;
+    bool quit;                          // Protegido por mutex
+    Job *undelivered;                   // Protegido por mutex; resultados cujo SDL_PushEvent falhou
+    SDL_AtomicInt stop;                 // Cancela todos os jobs (encerramento)
+    SDL_AtomicInt latest_image_job;     // Id do job de imagem mais recente; os anteriores sao cancelados
+    SDL_AtomicInt progress;             // Id do job de imagem + 0..JOB_PROGRESS_MAX (job_progress_pack)
+    Uint32 event_type;                  // Evento SDL customizado de job concluido (user.data1 = Job *)
+    int next_id;                        // Usado apenas pela thread principal
+};
+
 //------------------------------------------------------------------------------
 // Globals
 //------------------------------------------------------------------------------
@@ -79,10 +236,22 @@ static MyImage g_image_two = {
     .rect = { .x = 0.0f, .y = 0.0f, .w = 0.0f, .h = 0.0f }
 };
 
+// Ultimo estado concluido exibido na janela do histograma
 int histogram[256] = { 0 };
-int histogram_equalized[256] = { 0 }; // Tabela de mapeamento (LUT)
+static float g_average_intensity = 0.0f;
+static float g_std_deviation = 0.0f;
 static TTF_Font *g_font = NULL;
 
+// Histograma e estatisticas da imagem original (g_image_two), calculados uma unica vez
+static int g_original_histogram[256] = { 0 };
+static float g_original_average_intensity = 0.0f;
+static float g_original_std_deviation = 0.0f;
+static bool g_original_analyzed = false;
+
+static JobSystem g_jobs = { 0 };
+static bool g_requested_equalized = false;  // Estado pedido pelo usuario (pode estar em processamento)
+static int g_image_job_in_flight = 0;       // Id do job de imagem aguardado (0 = nenhum)
+
 //------------------------------------------------------------------------------
 // Function declarations (prototypes)
 //------------------------------------------------------------------------------
@@ -90,24 +259,41 @@ static void render_text(SDL_Renderer *renderer, const char *text, int x, int y,
 static bool MyWindow_initialize(MyWindow *window, const char *title, int width, int height, SDL_WindowFlags window_flags);
 static void MyWindow_destroy(MyWindow *window);
 static void MyImage_destroy(MyImage *image);
+static void MyImage_set_surface(MyImage *image, SDL_Renderer *renderer, SDL_Surface *surface);
 static void load_rgba32(const char *filename, SDL_Renderer *renderer, MyImage *output_image, MyImage *output_image_two);
-static void to_gray_scale(SDL_Renderer *renderer, MyImage *image);
-static void save_image_as_png(MyImage *image, const char *filename);
+static int verify_gray_scale(SDL_Surface *surface, Job *job);
+static bool to_gray_scale(SDL_Surface *input, SDL_Surface *output, Job *job);
+static bool save_image_as_png(SDL_Surface *surface, const char *filename);
 
-void apply_equalization(SDL_Renderer *renderer, MyImage *image);
-void restore_original_image(SDL_Renderer *renderer, MyImage *image_to_restore, MyImage *original_backup);
-void calculate_histogram(void);
-void calculate_equilize_vector(void);
+static bool jobs_initialize(void);
+static void jobs_shutdown(void);
+static int jobs_submit(JobKind kind, SDL_Surface *input, const char *filename, const int lut[256]);
+static bool job_cancelled(const Job *job);
+static void job_report_progress(const Job *job, int done, int total);
+
+bool apply_equalization(SDL_Surface *input, SDL_Surface *output, const int lut[256], int out_histogram[256], Job *job);
+bool calculate_histogram(SDL_Surface *surface, int out_histogram[256], Job *job);
+void calculate_equilize_vector(const int in_histogram[256], int out_lut[256]);
 
 float calculate_intensity(Uint8 r, Uint8 g, Uint8 b);
-float calculate_average_intensity(void);
-float calculate_standard_deviation(void);
+float calculate_average_intensity(const int in_histogram[256]);
+float calculate_standard_deviation(const int in_histogram[256], float average);
 
 
 const char *classify_intensity_string(int intensity);
 const char *classify_deviation_string(float deviation);
 int render_histogram(char str_max_bar[16]);
 
+static Uint8 gray_level(Uint8 r, Uint8 g, Uint8 b);
+static bool MappedFile_open(MappedFile *file, const char *filename);
+static void MappedFile_close(MappedFile *file);
+static bool ImageIndex_open(ImageIndex *index, const char *filename);
+static void ImageIndex_close(ImageIndex *index);
+static const IndexRecord *ImageIndex_find(const ImageIndex *index, const char *path);
+static int index_refresh(const char *index_filename, int path_count, char *paths[]);
+static int index_query(const char *index_filename, const char *field, const char *classification);
+static int index_nearest(const char *index_filename, const char *image_filename, int k);
+
 //------------------------------------------------------------------------------
 // Implementação de render_text
 //------------------------------------------------------------------------------
@@ -161,6 +347,19 @@ static void MyImage_destroy(MyImage *image)
     *image = (MyImage){ .surface = NULL, .texture = NULL, .rect = {0,0,0,0} };
 }
 
+// Troca a superficie exibida por "surface" (adquirindo uma referencia) e recria a textura.
+// Deve ser chamada na thread principal, dona do renderer.
+static void MyImage_set_surface(MyImage *image, SDL_Renderer *renderer, SDL_Surface *surface)
+{
+    if (!image || !renderer || !surface) return;
+    surface->refcount++;
+    if (image->surface) SDL_DestroySurface(image->surface); // Libera apenas a referencia anterior
+    image->surface = surface;
+    if (image->texture) SDL_DestroyTexture(image->texture);
+    image->texture = SDL_CreateTextureFromSurface(renderer, surface);
+    if (!image->texture) SDL_Log("Erro ao criar textura: %s", SDL_GetError());
+}
+
 //------------------------------------------------------------------------------
 // Funções de Manipulação de Imagem
 //------------------------------------------------------------------------------
@@ -189,79 +388,428 @@ static void load_rgba32(const char *filename, SDL_Renderer *renderer, MyImage *o
     SDL_GetTextureSize(output_image_two->texture, &output_image_two->rect.w, &output_image_two->rect.h);
 }
 
-static int verify_gray_scale(SDL_Renderer *renderer, MyImage *image)
+// Roda no worker da analise inicial. Retorna 1 se ja esta em escala de cinza, 0 se nao esta
+// e -1 em caso de erro ou cancelamento.
+static int verify_gray_scale(SDL_Surface *surface, Job *job)
 {
-    if (!renderer || !image || !image->surface) return -1;
-    SDL_LockSurface(image->surface);
-    const SDL_PixelFormatDetails *format = SDL_GetPixelFormatDetails(image->surface->format);
-    const size_t pixelCount = image->surface->w * image->surface->h;
-    Uint32 *pixels = (Uint32 *)image->surface->pixels;
+    if (!surface) return -1;
+    SDL_LockSurface(surface);
+    const SDL_PixelFormatDetails *format = SDL_GetPixelFormatDetails(surface->format);
     Uint8 r, g, b, a;
-    for (size_t i = 0; i < pixelCount; ++i)
+    for (int y = 0; y < surface->h; y++)
     {
-        SDL_GetRGBA(pixels[i], format, NULL, &r, &g, &b, &a);
-        if (!(r == g && b == g))
+        if (job_cancelled(job)) { SDL_UnlockSurface(surface); return -1; }
+        const Uint32 *pixels = (const Uint32 *)((const Uint8 *)surface->pixels + y * surface->pitch);
+        for (int x = 0; x < surface->w; x++)
         {
-            SDL_Log("Imagem nao esta em escala de cinza.");
-            return 0; // Não está em escala de cinza
-        };
+            SDL_GetRGBA(pixels[x], format, NULL, &r, &g, &b, &a);
+            if (!(r == g && b == g))
+            {
+                SDL_UnlockSurface(surface);
+                SDL_Log("Imagem nao esta em escala de cinza.");
+                return 0; // Não está em escala de cinza
+            };
+        }
+        job_report_progress(job, y + 1, surface->h);
     }
+    SDL_UnlockSurface(surface);
     SDL_Log("Imagem ja esta em escala de cinza.");
     return 1;
 }
 
 
-static void to_gray_scale(SDL_Renderer *renderer, MyImage *image)
+static Uint8 gray_level(Uint8 r, Uint8 g, Uint8 b)
 {
-    if (!renderer || !image || !image->surface) return;
+    float y = 0.2125f * r + 0.7154f * g + 0.0721f * b;
+    return (Uint8)roundf(y);
+}
+
+// Roda no worker da analise inicial: escreve em "output" a versao em tons de cinza de "input".
+// Retorna false se o job foi cancelado.
+static bool to_gray_scale(SDL_Surface *input, SDL_Surface *output, Job *job)
+{
+    if (!input || !output) return false;
     SDL_Log("Convertendo imagem para escala de cinza...");
-    SDL_LockSurface(image->surface);
-    const SDL_PixelFormatDetails *format = SDL_GetPixelFormatDetails(image->surface->format);
-    const size_t pixelCount = image->surface->w * image->surface->h;
-    Uint32 *pixels = (Uint32 *)image->surface->pixels;
+    const SDL_PixelFormatDetails *format = SDL_GetPixelFormatDetails(input->format);
     Uint8 r, g, b, a;
-    for (size_t i = 0; i < pixelCount; ++i)
+    for (int y = 0; y < input->h; y++)
     {
-        SDL_GetRGBA(pixels[i], format, NULL, &r, &g, &b, &a);
-        float y = 0.2125f * r + 0.7154f * g + 0.0721f * b;
-        Uint8 yy = (Uint8)roundf(y);
-        pixels[i] = SDL_MapRGBA(format, NULL, yy, yy, yy, a);
+        if (job_cancelled(job)) return false;
+        const Uint32 *src = (const Uint32 *)((const Uint8 *)input->pixels + y * input->pitch);
+        Uint32 *dst = (Uint32 *)((Uint8 *)output->pixels + y * output->pitch);
+        for (int x = 0; x < input->w; x++)
+        {
+            SDL_GetRGBA(src[x], format, NULL, &r, &g, &b, &a);
+            Uint8 yy = gray_level(r, g, b);
+            dst[x] = SDL_MapRGBA(format, NULL, yy, yy, yy, a);
+        }
+        job_report_progress(job, y + 1, input->h);
     }
-    SDL_UnlockSurface(image->surface);
-    if (image->texture) SDL_DestroyTexture(image->texture);
-    image->texture = SDL_CreateTextureFromSurface(renderer, image->surface);
     SDL_Log("Conversao para escala de cinza concluida.");
+    return true;
 }
 
-void apply_equalization(SDL_Renderer *renderer, MyImage *image)
+// Escreve em "output" a imagem "input" mapeada pela LUT e ja calcula o histograma do resultado.
+// Roda nos workers: "input" nunca e alterada, entao pode ser lida ao mesmo tempo pela thread principal.
+// Retorna false se o job foi cancelado.
+bool apply_equalization(SDL_Surface *input, SDL_Surface *output, const int lut[256], int out_histogram[256], Job *job)
 {
-    if (!renderer || !image || !image->surface) return;
-    calculate_equilize_vector();
-    SDL_LockSurface(image->surface);
-    const SDL_PixelFormatDetails *format = SDL_GetPixelFormatDetails(image->surface->format);
-    const size_t pixelCount = image->surface->w * image->surface->h;
-    Uint32 *pixels = (Uint32 *)image->surface->pixels;
-    for (size_t i = 0; i < pixelCount; i++)
+    for (int i = 0; i < 256; ++i) out_histogram[i] = 0;
+    if (!input || !output) return false;
+    const SDL_PixelFormatDetails *format = SDL_GetPixelFormatDetails(input->format);
+    for (int y = 0; y < input->h; y++)
     {
-        Uint8 r, g, b, a;
-        SDL_GetRGBA(pixels[i], format, NULL, &r, &g, &b, &a);
+        if (job_cancelled(job)) return false;
+        const Uint32 *src = (const Uint32 *)((const Uint8 *)input->pixels + y * input->pitch);
+        Uint32 *dst = (Uint32 *)((Uint8 *)output->pixels + y * output->pitch);
+        for (int x = 0; x < input->w; x++)
+        {
+            Uint8 r, g, b, a;
+            SDL_GetRGBA(src[x], format, NULL, &r, &g, &b, &a);
 
-        Uint8 new_intensity = (Uint8)histogram_equalized[r];
-        pixels[i] = SDL_MapRGBA(format, NULL, new_intensity, new_intensity, new_intensity, a);
+            Uint8 new_intensity = (Uint8)lut[r];
+            dst[x] = SDL_MapRGBA(format, NULL, new_intensity, new_intensity, new_intensity, a);
+            out_histogram[new_intensity]++;
+        }
+        job_report_progress(job, y + 1, input->h);
     }
-    SDL_UnlockSurface(image->surface);
-    if (image->texture) SDL_DestroyTexture(image->texture);
-    image->texture = SDL_CreateTextureFromSurface(renderer, image->surface);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Sistema de jobs (worker threads)
+//------------------------------------------------------------------------------
+// O processamento pesado roda nos workers e o resultado volta para a thread
+// principal por um evento SDL customizado. Os workers so leem as superficies de
+// entrada e escrevem em superficies novas; refcount, texturas e o estado exibido
+// sao tocados apenas pela thread principal. Todo job retirado da fila volta
+// para a thread principal exatamente uma vez, mesmo quando cancelado: por
+// evento ou, se a fila de eventos recusar, pela lista "undelivered".
+
+static bool job_cancelled(const Job *job)
+{
+    if (!job) return false;
+    if (SDL_GetAtomicInt(&g_jobs.stop)) return true;
+    return job->kind != JOB_SAVE && SDL_GetAtomicInt(&g_jobs.latest_image_job) != job->id;
 }
 
-void restore_original_image(SDL_Renderer *renderer, MyImage *image_to_restore, MyImage *original_backup)
+// O progresso e guardado junto com o id do job, para que um job substituido
+// nao sobrescreva o 0 gravado por jobs_submit para o job novo.
+static int job_progress_pack(int id, int value)
 {
-    if (!renderer || !image_to_restore || !original_backup) return;
-    SDL_memcpy(image_to_restore->surface->pixels, original_backup->surface->pixels, original_backup->surface->h * original_backup->surface->pitch);
-    if (image_to_restore->texture) SDL_DestroyTexture(image_to_restore->texture);
-    image_to_restore->texture = SDL_CreateTextureFromSurface(renderer, image_to_restore->surface);
+    return (int)(((Uint32)id & JOB_PROGRESS_ID_MASK) << JOB_PROGRESS_BITS | (Uint32)value);
 }
 
+// Progresso (0..JOB_PROGRESS_MAX) do job "id", ou 0 se g_jobs.progress pertence a outro job.
+static int job_progress_of(int id)
+{
+    int packed = SDL_GetAtomicInt(&g_jobs.progress);
+    if (((Uint32)packed >> JOB_PROGRESS_BITS) != ((Uint32)id & JOB_PROGRESS_ID_MASK)) return 0;
+    return packed & ((1 << JOB_PROGRESS_BITS) - 1);
+}
+
+static void job_report_progress(const Job *job, int done, int total)
+{
+    if (!job || job->kind == JOB_SAVE || total <= 0 || job->pass_count <= 0) return;
+    long long value = ((long long)job->pass * total + done) * JOB_PROGRESS_MAX / ((long long)job->pass_count * total);
+    int packed = job_progress_pack(job->id, (int)value);
+    for (;;)
+    {
+        int current = SDL_GetAtomicInt(&g_jobs.progress);
+        if (((Uint32)current >> JOB_PROGRESS_BITS) != ((Uint32)job->id & JOB_PROGRESS_ID_MASK)) return; // Job substituido
+        if (SDL_CompareAndSwapAtomicInt(&g_jobs.progress, current, packed)) return;
+    }
+}
+
+static void job_run(Job *job)
+{
+    switch (job->kind)
+    {
+        case JOB_ANALYZE:
+        {
+            // Passos: verificar escala de cinza, converter (se preciso) e calcular o histograma
+            SDL_Surface *gray = job->input;
+            job->pass_count = 3;
+            job->pass = 0;
+            int is_gray = verify_gray_scale(job->input, job);
+            if (is_gray < 0) break;
+            if (!is_gray)
+            {
+                job->pass = 1;
+                job->output = SDL_CreateSurface(job->input->w, job->input->h, job->input->format);
+                if (!job->output) { SDL_Log("Erro ao criar superficie em tons de cinza: %s", SDL_GetError()); break; }
+                if (!to_gray_scale(job->input, job->output, job)) break;
+                gray = job->output;
+            }
+            job->pass = 2;
+            if (!calculate_histogram(gray, job->histogram, job)) break;
+            job->ok = true;
+            break;
+        }
+        case JOB_EQUALIZE:
+        {
+            job->pass_count = 1;
+            job->pass = 0;
+            job->output = SDL_CreateSurface(job->input->w, job->input->h, job->input->format);
+            if (!job->output) { SDL_Log("Erro ao criar superficie equalizada: %s", SDL_GetError()); break; }
+            if (!apply_equalization(job->input, job->output, job->lut, job->histogram, job)) break;
+            job->ok = true;
+            break;
+        }
+        case JOB_SAVE:
+            job->ok = save_image_as_png(job->input, job->filename);
+            break;
+    }
+
+    if (job->ok && job->kind != JOB_SAVE)
+    {
+        job->average_intensity = calculate_average_intensity(job->histogram);
+        job->std_deviation = calculate_standard_deviation(job->histogram, job->average_intensity);
+    }
+    if (!job->ok) job->cancelled = job_cancelled(job);
+}
+
+static int SDLCALL job_worker(void *data)
+{
+    JobLane *lane = (JobLane *)data;
+    for (;;)
+    {
+        SDL_LockMutex(g_jobs.mutex);
+        while (!lane->pending && !g_jobs.quit) SDL_WaitCondition(g_jobs.condition, g_jobs.mutex);
+        if (g_jobs.quit)
+        {
+            SDL_UnlockMutex(g_jobs.mutex);
+            break;
+        }
+        Job *job = lane->pending;
+        lane->pending = NULL;
+        SDL_UnlockMutex(g_jobs.mutex);
+
+        job_run(job);
+
+        SDL_Event event;
+        SDL_zero(event);
+        event.type = g_jobs.event_type;
+        event.user.data1 = job;
+        if (!SDL_PushEvent(&event))
+        {
+            SDL_Log("Erro ao entregar resultado do job %d por evento: %s", job->id, SDL_GetError());
+            SDL_LockMutex(g_jobs.mutex);
+            job->next = g_jobs.undelivered;
+            g_jobs.undelivered = job;
+            SDL_UnlockMutex(g_jobs.mutex);
+        }
+    }
+    return 0;
+}
+
+// Libera um job e as superficies que ele referencia (thread principal).
+static void job_destroy(Job *job)
+{
+    if (!job) return;
+    if (job->input) SDL_DestroySurface(job->input);
+    if (job->output) SDL_DestroySurface(job->output);
+    SDL_free(job);
+}
+
+static bool jobs_initialize(void)
+{
+    g_jobs.event_type = SDL_RegisterEvents(1);
+    if (g_jobs.event_type == 0) { SDL_Log("Erro ao registrar evento de jobs: %s", SDL_GetError()); return false; }
+    g_jobs.mutex = SDL_CreateMutex();
+    g_jobs.condition = SDL_CreateCondition();
+    if (!g_jobs.mutex || !g_jobs.condition) { SDL_Log("Erro ao criar primitivas de sincronizacao: %s", SDL_GetError()); return false; }
+    for (int i = 0; i < JOB_LANE_COUNT; i++)
+    {
+        g_jobs.lanes[i].worker = SDL_CreateThread(job_worker, "job_worker", &g_jobs.lanes[i]);
+        if (!g_jobs.lanes[i].worker) { SDL_Log("Erro ao criar worker: %s", SDL_GetError()); return false; }
+    }
+    return true;
+}
+
+static void jobs_shutdown(void)
+{
+    if (!g_jobs.mutex) return;
+    SDL_SetAtomicInt(&g_jobs.stop, 1);
+    SDL_LockMutex(g_jobs.mutex);
+    g_jobs.quit = true;
+    SDL_BroadcastCondition(g_jobs.condition);
+    SDL_UnlockMutex(g_jobs.mutex);
+    for (int i = 0; i < JOB_LANE_COUNT; i++)
+    {
+        if (g_jobs.lanes[i].worker) SDL_WaitThread(g_jobs.lanes[i].worker, NULL);
+        g_jobs.lanes[i].worker = NULL;
+    }
+
+    // Jobs que nao chegaram a rodar e resultados que nao foram consumidos
+    for (int i = 0; i < JOB_LANE_COUNT; i++)
+    {
+        job_destroy(g_jobs.lanes[i].pending);
+        g_jobs.lanes[i].pending = NULL;
+    }
+    while (g_jobs.undelivered)
+    {
+        Job *job = g_jobs.undelivered;
+        g_jobs.undelivered = job->next;
+        job_destroy(job);
+    }
+    SDL_Event event;
+    while (g_jobs.event_type && SDL_PeepEvents(&event, 1, SDL_GETEVENT, g_jobs.event_type, g_jobs.event_type) > 0)
+        job_destroy((Job *)event.user.data1);
+
+    SDL_DestroyCondition(g_jobs.condition);
+    SDL_DestroyMutex(g_jobs.mutex);
+    g_jobs.condition = NULL;
+    g_jobs.mutex = NULL;
+}
+
+// Enfileira um job sobre "input" e retorna seu id (0 em caso de erro).
+// Um novo job substitui o job pendente da mesma lane; um job de imagem tambem cancela o que estiver em andamento.
+static int jobs_submit(JobKind kind, SDL_Surface *input, const char *filename, const int lut[256])
+{
+    if (!g_jobs.mutex || !input) return 0;
+    Job *job = SDL_calloc(1, sizeof(Job));
+    if (!job) return 0;
+    job->kind = kind;
+    job->id = ++g_jobs.next_id;
+    job->input = input;
+    input->refcount++;
+    if (filename) SDL_strlcpy(job->filename, filename, sizeof(job->filename));
+    if (lut) SDL_memcpy(job->lut, lut, sizeof(job->lut));
+
+    JobLane *lane = &g_jobs.lanes[kind == JOB_SAVE ? JOB_LANE_SAVE : JOB_LANE_IMAGE];
+    SDL_LockMutex(g_jobs.mutex);
+    Job *replaced = lane->pending;
+    lane->pending = job;
+    if (kind != JOB_SAVE)
+    {
+        SDL_SetAtomicInt(&g_jobs.progress, job_progress_pack(job->id, 0));
+        SDL_SetAtomicInt(&g_jobs.latest_image_job, job->id);
+    }
+    SDL_BroadcastCondition(g_jobs.condition);
+    SDL_UnlockMutex(g_jobs.mutex);
+
+    if (replaced && replaced->kind == JOB_SAVE) SDL_Log("Salvamento pendente substituido pelo mais recente.");
+    job_destroy(replaced);
+    return job->id;
+}
+
+// Descarta o job de imagem pendente e cancela o que estiver em andamento.
+static void jobs_cancel_image(void)
+{
+    if (!g_jobs.mutex) return;
+    SDL_LockMutex(g_jobs.mutex);
+    Job *pending = g_jobs.lanes[JOB_LANE_IMAGE].pending;
+    g_jobs.lanes[JOB_LANE_IMAGE].pending = NULL;
+    SDL_SetAtomicInt(&g_jobs.latest_image_job, ++g_jobs.next_id);
+    SDL_UnlockMutex(g_jobs.mutex);
+    job_destroy(pending);
+}
+
+// Troca a imagem exibida e o histograma/estatisticas mostrados (thread principal).
+static void show_image_state(SDL_Surface *surface, const int in_histogram[256], float average, float deviation, bool equalized)
+{
+    MyImage_set_surface(&g_image, g_window.renderer, surface);
+    SDL_memcpy(histogram, in_histogram, sizeof(histogram));
+    g_average_intensity = average;
+    g_std_deviation = deviation;
+    image_equalized = equalized;
+    SDL_Log("Nova Media (%.0f) -> %s", g_average_intensity, classify_intensity_string((int)roundf(g_average_intensity)));
+    SDL_Log("Novo Desvio(%.2f) -> %s", g_std_deviation, classify_deviation_string(g_std_deviation));
+}
+
+// Consome o resultado de um job na thread principal. Retorna true se a tela precisa ser redesenhada.
+static bool handle_job_result(Job *job)
+{
+    bool changed = false;
+    if (job->kind == JOB_SAVE)
+    {
+        if (!job->ok) SDL_Log("Falha ao salvar '%s'.", job->filename);
+    }
+    else if (job->id == g_image_job_in_flight)
+    {
+        g_image_job_in_flight = 0;
+        if (job->ok)
+        {
+            if (job->kind == JOB_ANALYZE && job->input == g_image_two.surface)
+            {
+                // A versao em tons de cinza gerada pelo worker passa a ser o backup original
+                if (job->output)
+                {
+                    job->output->refcount++;
+                    SDL_DestroySurface(g_image_two.surface);
+                    g_image_two.surface = job->output;
+                    if (g_image_two.texture) SDL_DestroyTexture(g_image_two.texture); // Textura colorida, nao exibida
+                    g_image_two.texture = NULL;
+                }
+                SDL_memcpy(g_original_histogram, job->histogram, sizeof(g_original_histogram));
+                g_original_average_intensity = job->average_intensity;
+                g_original_std_deviation = job->std_deviation;
+                g_original_analyzed = true;
+            }
+            show_image_state(job->output ? job->output : job->input, job->histogram,
+                             job->average_intensity, job->std_deviation, job->kind == JOB_EQUALIZE);
+        }
+        else
+        {
+            if (!job->cancelled) SDL_Log("Erro ao processar a imagem (job %d).", job->id);
+            g_requested_equalized = image_equalized;
+        }
+        changed = true;
+    }
+    // Demais casos: job de imagem obsoleto (substituido por um mais recente), apenas descartado
+    job_destroy(job);
+    return changed;
+}
+
+// Consome os resultados que nao puderam ser entregues por evento. Retorna true se a tela mudou.
+static bool jobs_poll_undelivered(void)
+{
+    if (!g_jobs.mutex) return false;
+    SDL_LockMutex(g_jobs.mutex);
+    Job *job = g_jobs.undelivered;
+    g_jobs.undelivered = NULL;
+    SDL_UnlockMutex(g_jobs.mutex);
+
+    bool changed = false;
+    while (job)
+    {
+        Job *next = job->next;
+        if (handle_job_result(job)) changed = true;
+        job = next;
+    }
+    return changed;
+}
+
+// Pede a exibicao da imagem original ou equalizada sem bloquear o loop de eventos.
+// Antes da analise inicial so a propria analise e enviada (o botao fica inativo ate ela terminar).
+// Depois dela, restaurar o original nao precisa de job e equalizar so aplica a LUT.
+static void request_image_state(bool equalized)
+{
+    int id = 0;
+    if (!g_original_analyzed)
+    {
+        g_requested_equalized = false;
+        id = jobs_submit(JOB_ANALYZE, g_image_two.surface, NULL, NULL);
+    }
+    else if (!equalized)
+    {
+        g_requested_equalized = false;
+        jobs_cancel_image();
+        g_image_job_in_flight = 0;
+        show_image_state(g_image_two.surface, g_original_histogram, g_original_average_intensity, g_original_std_deviation, false);
+        return;
+    }
+    else
+    {
+        int lut[256];
+        g_requested_equalized = true;
+        calculate_equilize_vector(g_original_histogram, lut);
+        id = jobs_submit(JOB_EQUALIZE, g_image_two.surface, NULL, lut);
+    }
+    if (id != 0) g_image_job_in_flight = id;
+    else g_requested_equalized = image_equalized;
+}
 
 //------------------------------------------------------------------------------
 // initialize / shutdown
@@ -276,11 +824,13 @@ static SDL_AppResult initialize(void)
         SDL_Log("Erro ao criar a janela e/ou renderizador: %s", SDL_GetError());
         return SDL_APP_FAILURE;
     }
+    if (!jobs_initialize()) return SDL_APP_FAILURE;
     return SDL_APP_CONTINUE;
 }
 
 static void shutdown(void)
 {
+    jobs_shutdown();
     if (g_font) { TTF_CloseFont(g_font); g_font = NULL; }
     MyImage_destroy(&g_image);
     MyImage_destroy(&g_image_two);
@@ -361,6 +911,26 @@ int render_histogram(char str_max_bar[16])
     return max_value;
 }
 
+//------------------------------------------------------------------------------
+// Progress indicator
+//------------------------------------------------------------------------------
+static void render_progress(SDL_Color text_color)
+{
+    int progress = job_progress_of(g_image_job_in_flight);
+    SDL_FRect track = { .x = h_button.rect.x, .y = h_button.rect.y + h_button.rect.h + 10, .w = h_button.rect.w, .h = 8 };
+    SDL_FRect fill = track;
+    fill.w = track.w * (float)progress / (float)JOB_PROGRESS_MAX;
+
+    SDL_SetRenderDrawColor(h_window.renderer, 80, 80, 100, 255);
+    SDL_RenderFillRect(h_window.renderer, &track);
+    SDL_SetRenderDrawColor(h_window.renderer, 20, 150, 220, 255);
+    SDL_RenderFillRect(h_window.renderer, &fill);
+
+    char str_progress[32];
+    snprintf(str_progress, sizeof(str_progress), "Processando... %d%%", progress * 100 / JOB_PROGRESS_MAX);
+    render_text(h_window.renderer, str_progress, (int)track.x, (int)(track.y + track.h + 4), text_color);
+}
+
 //------------------------------------------------------------------------------
 // Render principal (imagem + histograma)
 //------------------------------------------------------------------------------
@@ -396,15 +966,14 @@ static void render(void)
     render_text(h_window.renderer, "0", 35, DEFAULT_H_WINDOW_HEIGHT - 170, light_gray);
     render_text(h_window.renderer, "255", DEFAULT_H_WINDOW_WIDTH - 65, DEFAULT_H_WINDOW_HEIGHT - 170, light_gray);
 
-    float avg_intensity = calculate_average_intensity();
-    float std_deviation = calculate_standard_deviation();
-    const char *class_intensity = classify_intensity_string((int)roundf(avg_intensity));
-    const char *class_deviation = classify_deviation_string(std_deviation);
+    // Estatisticas do ultimo job concluido (calculadas nos workers a partir do histograma)
+    const char *class_intensity = classify_intensity_string((int)roundf(g_average_intensity));
+    const char *class_deviation = classify_deviation_string(g_std_deviation);
 
     char str_avg_intensity[16];
     char str_std_deviation[16];
-    snprintf(str_avg_intensity, sizeof(str_avg_intensity), " %.2f", avg_intensity);
-    snprintf(str_std_deviation, sizeof(str_std_deviation), " %.2f", std_deviation);
+    snprintf(str_avg_intensity, sizeof(str_avg_intensity), " %.2f", g_average_intensity);
+    snprintf(str_std_deviation, sizeof(str_std_deviation), " %.2f", g_std_deviation);
 
     render_text(h_window.renderer, "MD: ", 20, 450, light_gray);
     render_text(h_window.renderer, str_avg_intensity, 80, 450, light_gray);
@@ -415,6 +984,8 @@ static void render(void)
     render_text(h_window.renderer, "CC: ", 20, 510, light_gray);
     render_text(h_window.renderer, class_deviation, 80, 510, light_gray);
 
+    if (g_image_job_in_flight != 0) render_progress(white);
+
     SDL_RenderPresent(h_window.renderer);
 }
 
@@ -429,13 +1000,32 @@ static void loop(void)
 
     while (isRunning)
     {
+        // Com um job em andamento o loop acorda a cada PROGRESS_REFRESH_MS, entao
+        // um resultado sem evento e recolhido aqui em pouco tempo.
+        if (jobs_poll_undelivered()) mustRefresh = true;
+
         if (mustRefresh) {
             render();
             mustRefresh = false;
         }
 
-        while (SDL_PollEvent(&event))
+        // Com um job em andamento acorda periodicamente para atualizar o progresso;
+        // caso contrario dorme ate o proximo evento.
+        bool busy = g_image_job_in_flight != 0;
+        if (!SDL_WaitEventTimeout(&event, busy ? PROGRESS_REFRESH_MS : -1))
+        {
+            mustRefresh = busy;
+            continue;
+        }
+
+        do
         {
+            if (event.type == g_jobs.event_type)
+            {
+                if (handle_job_result((Job *)event.user.data1)) mustRefresh = true;
+                continue;
+            }
+
             switch (event.type)
             {
                 case SDL_EVENT_QUIT:
@@ -446,7 +1036,7 @@ static void loop(void)
                     else if (event.key.key == SDLK_S) // Salvar imagem
                     {
                         SDL_Log("Acao executada: Salvar Imagem.");
-                        save_image_as_png(&g_image, "output_image.png");
+                        jobs_submit(JOB_SAVE, g_image.surface, "output_image.png", NULL);
                     }
                     break;
                 case SDL_EVENT_WINDOW_CLOSE_REQUESTED:
@@ -461,32 +1051,22 @@ static void loop(void)
 
             if (handle_button_event(&h_button, &event, h_window.window))
             {
-                if (event.type == SDL_EVENT_MOUSE_BUTTON_UP && h_button.hovered)
+                if (event.type == SDL_EVENT_MOUSE_BUTTON_UP && h_button.hovered && !g_original_analyzed)
                 {
-                    image_equalized = !image_equalized;
-                    if (image_equalized)
-                    {
-                        SDL_Log("Acao executada: Equalizar Imagem.");
-                        apply_equalization(g_window.renderer, &g_image);
-                    }
-                    else
-                    {
-                        SDL_Log("Acao executada: Restaurar Imagem Original.");
-                        restore_original_image(g_window.renderer, &g_image, &g_image_two);
-                    }
-
-                    calculate_histogram();
-                    
-                    float avg_intensity = calculate_average_intensity();
-                    float std_deviation = calculate_standard_deviation();
-                    SDL_Log("Nova Media (%.0f) -> %s", avg_intensity, classify_intensity_string((int)roundf(avg_intensity)));
-                    SDL_Log("Novo Desvio(%.2f) -> %s", std_deviation, classify_deviation_string(std_deviation));
+                    SDL_Log("Aguarde a conversao/analise inicial da imagem.");
+                }
+                else if (event.type == SDL_EVENT_MOUSE_BUTTON_UP && h_button.hovered)
+                {
+                    // Um novo clique substitui o job anterior ainda em andamento
+                    if (!g_requested_equalized) SDL_Log("Acao executada: Equalizar Imagem.");
+                    else SDL_Log("Acao executada: Restaurar Imagem Original.");
+                    request_image_state(!g_requested_equalized);
 
                     mustRefresh = true;
                 }
                 else { mustRefresh = true; }
             }
-        }
+        } while (SDL_PollEvent(&event));
     }
 }
 
@@ -495,70 +1075,64 @@ static void loop(void)
 //------------------------------------------------------------------------------
 float calculate_intensity(Uint8 r, Uint8 g, Uint8 b) { return (r + g + b) / 3.0f; }
 
-float calculate_average_intensity()
-{
-    if (!g_image.surface) return 0.0f;
-    int pixelCount = g_image.surface->w * g_image.surface->h;
-    if (pixelCount == 0) return 0.0f;
-    float soma = 0.0f;
-    SDL_LockSurface(g_image.surface);
-    Uint32 *pixels = (Uint32 *)g_image.surface->pixels;
-    const SDL_PixelFormatDetails *format = SDL_GetPixelFormatDetails(g_image.surface->format);
-    for (int i = 0; i < pixelCount; i++) {
-        Uint8 r, g, b, a;
-        SDL_GetRGBA(pixels[i], format, NULL, &r, &g, &b, &a);
-        soma += r; // Como a imagem já está em escala de cinza, não preciso calcular a média de RGB
-    }
-    SDL_UnlockSurface(g_image.surface);
-    return soma / (float)pixelCount;
-}
-
-float calculate_standard_deviation()
-{
-    if (!g_image.surface) return 0.0f;
-    int pixelCount = g_image.surface->w * g_image.surface->h;
-    if (pixelCount == 0) return 0.0f;
-    float media = calculate_average_intensity();
-    float soma = 0.0f;
-    SDL_LockSurface(g_image.surface);
-    Uint32 *pixels = (Uint32 *)g_image.surface->pixels;
-    const SDL_PixelFormatDetails *format = SDL_GetPixelFormatDetails(g_image.surface->format);
-    for (int i = 0; i < pixelCount; i++) {
-        Uint8 r, g, b, a;
-        SDL_GetRGBA(pixels[i], format, NULL, &r, &g, &b, &a);
-        float diff = r - media; // Como a imagem já está em escala de cinza, não preciso calcular a média de RGB, só preciso do r.
-        soma += diff * diff;
-    }
-    SDL_UnlockSurface(g_image.surface);
-    float variancia = soma / (float)pixelCount;
-    return sqrtf(variancia);
-}
-
-void calculate_histogram()
-{
-    if (!g_image.surface) return;
-    for (int i = 0; i < 256; ++i) histogram[i] = 0;
-    int pixelCount = g_image.surface->w * g_image.surface->h;
-    if (pixelCount == 0) return;
-    SDL_LockSurface(g_image.surface);
-    Uint32 *pixels = (Uint32 *)g_image.surface->pixels;
-    const SDL_PixelFormatDetails *format = SDL_GetPixelFormatDetails(g_image.surface->format);
-    for (int i = 0; i < pixelCount; i++) {
-        Uint8 r, g, b, a;
-        SDL_GetRGBA(pixels[i], format, NULL, &r, &g, &b, &a);
-        histogram[r]++;
-    }
-    SDL_UnlockSurface(g_image.surface);
-}
-
-void calculate_equilize_vector()
-{
-    if (!g_image.surface) return;
+// Media e desvio padrao sao obtidos do histograma (256 niveis) em vez de varrer a imagem de novo.
+// Como a imagem está em escala de cinza, o nível de cinza é o próprio r.
+float calculate_average_intensity(const int in_histogram[256])
+{
+    double pixelCount = 0.0;
+    double soma = 0.0;
+    for (int i = 0; i < 256; i++) {
+        pixelCount += in_histogram[i];
+        soma += (double)i * in_histogram[i];
+    }
+    if (pixelCount == 0.0) return 0.0f;
+    return (float)(soma / pixelCount);
+}
+
+float calculate_standard_deviation(const int in_histogram[256], float average)
+{
+    double pixelCount = 0.0;
+    double soma = 0.0;
+    for (int i = 0; i < 256; i++) {
+        double diff = i - average;
+        pixelCount += in_histogram[i];
+        soma += diff * diff * in_histogram[i];
+    }
+    if (pixelCount == 0.0) return 0.0f;
+    double variancia = soma / pixelCount;
+    return (float)sqrt(variancia);
+}
+
+// Roda nos workers: percorre a superficie linha a linha (respeitando o pitch) para
+// poder reportar progresso e abandonar o trabalho se o job for cancelado.
+// Superficies RGBA32 nao exigem SDL_LockSurface, o que permite leituras concorrentes.
+bool calculate_histogram(SDL_Surface *surface, int out_histogram[256], Job *job)
+{
+    for (int i = 0; i < 256; ++i) out_histogram[i] = 0;
+    if (!surface) return false;
+    const SDL_PixelFormatDetails *format = SDL_GetPixelFormatDetails(surface->format);
+    for (int y = 0; y < surface->h; y++) {
+        if (job_cancelled(job)) return false;
+        const Uint32 *pixels = (const Uint32 *)((const Uint8 *)surface->pixels + y * surface->pitch);
+        for (int x = 0; x < surface->w; x++) {
+            Uint8 r, g, b, a;
+            SDL_GetRGBA(pixels[x], format, NULL, &r, &g, &b, &a);
+            out_histogram[r]++;
+        }
+        job_report_progress(job, y + 1, surface->h);
+    }
+    return true;
+}
+
+void calculate_equilize_vector(const int in_histogram[256], int out_lut[256])
+{
+    int pixelCount = 0;
+    for (int i = 0; i < 256; ++i) pixelCount += in_histogram[i];
+    if (pixelCount == 0) { for (int i = 0; i < 256; ++i) out_lut[i] = i; return; }
     int sum = 0;
-    int pixelCount = g_image.surface->w * g_image.surface->h;
     for (int i = 0; i < 256; ++i) {
-        sum += histogram[i];
-        histogram_equalized[i] = roundf(((float)sum * (255.0f / (float)pixelCount)));
+        sum += in_histogram[i];
+        out_lut[i] = roundf(((float)sum * (255.0f / (float)pixelCount)));
     }
 }
 
@@ -581,34 +1155,646 @@ const char *classify_deviation_string(float deviation)
 // Funções de Manipulação de Imagem
 //------------------------------------------------------------------------------
 
-static void save_image_as_png(MyImage *image, const char *filename)
+// Executada em um worker (job JOB_SAVE).
+static bool save_image_as_png(SDL_Surface *surface, const char *filename)
 {
-    if (!image || !image->surface)
+    if (!surface)
     {
         SDL_Log("Erro ao salvar: a imagem ou sua superficie e nula.");
-        return;
+        return false;
     }
 
-    if (IMG_SavePNG(image->surface, filename) != 1)
+    if (IMG_SavePNG(surface, filename) != 1)
     {
         SDL_Log("Nao foi possivel salvar a imagem em '%s': %s", filename, SDL_GetError());
+        return false;
+    }
+    SDL_Log("Imagem salva com sucesso em '%s'.", filename);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Indice persistente de histogramas (modo linha de comando)
+//------------------------------------------------------------------------------
+// Permite filtrar grandes acervos (ex.: todas as imagens com CC = Baixo contraste)
+// sem decodificar as imagens de novo: histograma e estatisticas de cada arquivo
+// ficam gravados no indice, que e lido via mapeamento em memoria. Na atualizacao,
+// apenas arquivos novos ou com mtime/tamanho diferentes sao decodificados.
+
+static const char *IMAGE_EXTENSIONS[] = { ".png", ".jpg", ".jpeg", ".bmp", ".gif", ".tga", ".tif", ".tiff", ".webp", ".qoi", ".pnm", ".pgm", ".ppm" };
+
+#ifdef _WIN32
+// Os caminhos sao UTF-8 (como em SDL_IOFromFile); a API "W" evita a code page ANSI.
+// Com FILE_FLAG_BACKUP_SEMANTICS tambem abre pastas.
+static HANDLE open_path_utf8(const char *path, DWORD access, DWORD share, DWORD flags)
+{
+    int wide_length = MultiByteToWideChar(CP_UTF8, 0, path, -1, NULL, 0);
+    if (wide_length <= 0) return INVALID_HANDLE_VALUE;
+    WCHAR *wide_path = SDL_malloc(wide_length * sizeof(WCHAR));
+    if (!wide_path) return INVALID_HANDLE_VALUE;
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, wide_length);
+    HANDLE handle = CreateFileW(wide_path, access, share, NULL, OPEN_EXISTING, flags, NULL);
+    SDL_free(wide_path);
+    return handle;
+}
+#endif
+
+static bool MappedFile_open(MappedFile *file, const char *filename)
+{
+    *file = (MappedFile){ 0 };
+#ifdef _WIN32
+    file->file = open_path_utf8(filename, GENERIC_READ, FILE_SHARE_READ, FILE_ATTRIBUTE_NORMAL);
+    if (file->file == INVALID_HANDLE_VALUE) { file->file = NULL; return false; }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file->file, &size) || size.QuadPart == 0) { MappedFile_close(file); return false; }
+    file->mapping = CreateFileMappingW(file->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!file->mapping) { MappedFile_close(file); return false; }
+    file->data = (const Uint8 *)MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!file->data) { MappedFile_close(file); return false; }
+    file->size = (size_t)size.QuadPart;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) { close(fd); return false; }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // O mapeamento continua valido sem o descritor
+    if (data == MAP_FAILED) return false;
+    file->data = (const Uint8 *)data;
+    file->size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+static void MappedFile_close(MappedFile *file)
+{
+    if (!file) return;
+#ifdef _WIN32
+    if (file->data) UnmapViewOfFile(file->data);
+    if (file->mapping) CloseHandle(file->mapping);
+    if (file->file) CloseHandle(file->file);
+#else
+    if (file->data) munmap((void *)file->data, file->size);
+#endif
+    *file = (MappedFile){ 0 };
+}
+
+// Retorna false se o indice nao existe ou e invalido (nesse caso nada fica mapeado).
+static bool ImageIndex_open(ImageIndex *index, const char *filename)
+{
+    *index = (ImageIndex){ 0 };
+    if (!MappedFile_open(&index->file, filename)) return false;
+
+    const IndexHeader *header = (const IndexHeader *)index->file.data;
+    bool valid = index->file.size >= sizeof(IndexHeader) &&
+                 SDL_memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+                 header->version == INDEX_VERSION &&
+                 header->record_size == sizeof(IndexRecord) &&
+                 header->count == (index->file.size - sizeof(IndexHeader)) / sizeof(IndexRecord) &&
+                 (index->file.size - sizeof(IndexHeader)) % sizeof(IndexRecord) == 0;
+    if (!valid)
+    {
+        SDL_Log("Indice '%s' invalido ou de outra versao.", filename);
+        ImageIndex_close(index);
+        return false;
     }
+    index->records = (const IndexRecord *)(index->file.data + sizeof(IndexHeader));
+    index->count = (size_t)header->count;
+
+    // Os caminhos sao lidos como strings e ImageIndex_find depende da ordenacao:
+    // cada caminho precisa terminar em '\0' dentro do registro e ser maior que o anterior.
+    for (size_t i = 0; i < index->count; i++)
+    {
+        const IndexRecord *record = &index->records[i];
+        if (!SDL_memchr(record->path, '\0', sizeof(record->path)) ||
+            (i > 0 && SDL_strcmp(index->records[i - 1].path, record->path) >= 0))
+        {
+            SDL_Log("Indice '%s' corrompido (registro %llu).", filename, (unsigned long long)i);
+            ImageIndex_close(index);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void ImageIndex_close(ImageIndex *index)
+{
+    if (!index) return;
+    MappedFile_close(&index->file);
+    *index = (ImageIndex){ 0 };
+}
+
+// Busca binaria: os registros sao gravados ordenados por caminho.
+static const IndexRecord *ImageIndex_find(const ImageIndex *index, const char *path)
+{
+    size_t low = 0, high = index->count;
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        int cmp = SDL_strcmp(path, index->records[mid].path);
+        if (cmp == 0) return &index->records[mid];
+        if (cmp < 0) high = mid;
+        else low = mid + 1;
+    }
+    return NULL;
+}
+
+static bool IndexRecord_matches(const IndexRecord *record, const SDL_PathInfo *info)
+{
+    return record->mtime == info->modify_time && record->size == info->size;
+}
+
+// Decodifica a imagem e calcula a assinatura (histograma em tons de cinza + estatisticas).
+static bool IndexRecord_compute(IndexRecord *record, const char *path, const SDL_PathInfo *info)
+{
+    SDL_Surface *loaded = IMG_Load(path);
+    if (!loaded) { SDL_Log("Erro ao carregar a imagem '%s': %s", path, SDL_GetError()); return false; }
+    SDL_Surface *surface = SDL_ConvertSurface(loaded, SDL_PIXELFORMAT_RGBA32);
+    SDL_DestroySurface(loaded);
+    if (!surface) { SDL_Log("Erro ao converter '%s' para RGBA32: %s", path, SDL_GetError()); return false; }
+
+    int counts[256] = { 0 };
+    const SDL_PixelFormatDetails *format = SDL_GetPixelFormatDetails(surface->format);
+    for (int y = 0; y < surface->h; y++)
+    {
+        const Uint32 *pixels = (const Uint32 *)((const Uint8 *)surface->pixels + y * surface->pitch);
+        for (int x = 0; x < surface->w; x++)
+        {
+            Uint8 r, g, b, a;
+            SDL_GetRGBA(pixels[x], format, NULL, &r, &g, &b, &a);
+            counts[gray_level(r, g, b)]++;
+        }
+    }
+
+    SDL_zerop(record);
+    SDL_strlcpy(record->path, path, sizeof(record->path));
+    record->mtime = info->modify_time;
+    record->size = info->size;
+    record->width = (Uint32)surface->w;
+    record->height = (Uint32)surface->h;
+    record->average_intensity = calculate_average_intensity(counts);
+    record->std_deviation = calculate_standard_deviation(counts, record->average_intensity);
+    Uint64 total = (Uint64)surface->w * (Uint64)surface->h;
+    for (int i = 0; total > 0 && i < 256; i++)
+        record->histogram[i] = (Uint16)((Uint64)counts[i] * INDEX_HISTOGRAM_SCALE / total);
+
+    SDL_DestroySurface(surface);
+    return true;
+}
+
+static bool is_separator(char c)
+{
+#ifdef _WIN32
+    return c == '/' || c == '\\';
+#else
+    return c == '/';
+#endif
+}
+
+// Caminho absoluto e normalizado so pelo texto (sem ".", ".." nem separadores repetidos).
+// No Windows os separadores viram '/'. Retorna NULL se faltar memoria.
+static char *normalize_path(const char *path)
+{
+    char *absolute = NULL;
+    bool is_absolute = is_separator(path[0]);
+#ifdef _WIN32
+    bool has_drive = path[0] && path[1] == ':' && is_separator(path[2]);
+    bool is_unc = is_separator(path[0]) && is_separator(path[1]);
+    if (has_drive || is_unc) absolute = SDL_strdup(path);
     else
     {
-        SDL_Log("Imagem salva com sucesso em '%s'.", filename);
+        // Relativo ao diretorio atual ou, se comecar com separador, a raiz do drive atual
+        char *cwd = SDL_GetCurrentDirectory();
+        if (!cwd) return NULL;
+        if (is_absolute && cwd[0] && cwd[1] == ':') SDL_asprintf(&absolute, "%c:%s", cwd[0], path);
+        else SDL_asprintf(&absolute, "%s/%s", cwd, path);
+        SDL_free(cwd);
     }
+    if (!absolute) return NULL;
+    for (char *c = absolute; *c; c++) if (*c == '\\') *c = '/';
+    // Preserva "C:" ou a primeira barra de "//servidor"
+    size_t prefix = 0;
+    if (absolute[0] && absolute[1] == ':') prefix = 2;
+    else if (absolute[0] == '/' && absolute[1] == '/') prefix = 1;
+#else
+    if (is_absolute) absolute = SDL_strdup(path);
+    else
+    {
+        char *cwd = SDL_GetCurrentDirectory();
+        if (!cwd) return NULL;
+        SDL_asprintf(&absolute, "%s/%s", cwd, path);
+        SDL_free(cwd);
+    }
+    size_t prefix = 0;
+#endif
+    if (!absolute) return NULL;
+
+    // Reconstroi componente a componente; o resultado nunca e maior que a entrada
+    size_t length = SDL_strlen(absolute);
+    char *result = SDL_malloc(length + 2);
+    if (!result) { SDL_free(absolute); return NULL; }
+    SDL_memcpy(result, absolute, prefix);
+    size_t out = prefix;
+    const char *component = absolute + prefix;
+    while (*component)
+    {
+        while (*component == '/') component++;
+        const char *end = component;
+        while (*end && *end != '/') end++;
+        size_t component_length = (size_t)(end - component);
+        if (component_length == 2 && component[0] == '.' && component[1] == '.')
+        {
+            while (out > prefix && result[out - 1] != '/') out--;
+            if (out > prefix) out--;
+        }
+        else if (component_length > 0 && !(component_length == 1 && component[0] == '.'))
+        {
+            result[out++] = '/';
+            SDL_memcpy(result + out, component, component_length);
+            out += component_length;
+        }
+        component = end;
+    }
+    if (out == prefix) result[out++] = '/';
+    result[out] = '\0';
+    SDL_free(absolute);
+    return result;
+}
+
+// Caminho real do arquivo/pasta, com links simbolicos resolvidos, ou NULL se ele nao existe.
+static char *resolve_path(const char *path)
+{
+#ifdef _WIN32
+    HANDLE handle = open_path_utf8(path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_FLAG_BACKUP_SEMANTICS);
+    if (handle == INVALID_HANDLE_VALUE) return NULL;
+    DWORD length = GetFinalPathNameByHandleW(handle, NULL, 0, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS);
+    WCHAR *wide_path = length ? SDL_malloc((length + 1) * sizeof(WCHAR)) : NULL;
+    if (wide_path && GetFinalPathNameByHandleW(handle, wide_path, length + 1, FILE_NAME_NORMALIZED | VOLUME_NAME_DOS) == 0)
+    {
+        SDL_free(wide_path);
+        wide_path = NULL;
+    }
+    CloseHandle(handle);
+    if (!wide_path) return NULL;
+
+    // Remove o prefixo "\\?\" ("\\?\UNC\servidor" vira "\\servidor")
+    WCHAR *start = wide_path;
+    if (SDL_wcsncmp(wide_path, L"\\\\?\\UNC\\", 8) == 0) { start = wide_path + 6; start[0] = L'\\'; }
+    else if (SDL_wcsncmp(wide_path, L"\\\\?\\", 4) == 0) start = wide_path + 4;
+    int utf8_length = WideCharToMultiByte(CP_UTF8, 0, start, -1, NULL, 0, NULL, NULL);
+    char *resolved = utf8_length > 0 ? SDL_malloc(utf8_length) : NULL;
+    if (resolved) WideCharToMultiByte(CP_UTF8, 0, start, -1, resolved, utf8_length, NULL, NULL);
+    SDL_free(wide_path);
+    return resolved;
+#else
+    char *resolved = realpath(path, NULL);
+    if (!resolved) return NULL;
+    char *copy = SDL_strdup(resolved);
+    free(resolved); // Alocado pela libc
+    return copy;
+#endif
+}
+
+// Chave do indice: o caminho real quando o arquivo existe, para que um mesmo arquivo fisico
+// (acessado por links simbolicos ou caminhos diferentes) gere um unico registro; senao so a
+// forma normalizada (ex.: registro de um arquivo que foi apagado). Retorna NULL se faltar memoria.
+static char *canonical_path(const char *path)
+{
+    char *resolved = resolve_path(path);
+    char *result = normalize_path(resolved ? resolved : path);
+    SDL_free(resolved);
+    return result;
+}
+
+static bool directory_id(const char *path, DirectoryId *id)
+{
+#ifdef _WIN32
+    HANDLE handle = open_path_utf8(path, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_FLAG_BACKUP_SEMANTICS);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+    BY_HANDLE_FILE_INFORMATION info;
+    bool ok = GetFileInformationByHandle(handle, &info);
+    CloseHandle(handle);
+    if (!ok) return false;
+    id->device = info.dwVolumeSerialNumber;
+    id->file = ((Uint64)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+    id->device = (Uint64)st.st_dev;
+    id->file = (Uint64)st.st_ino;
+#endif
+    return true;
+}
+
+// Marca a pasta como visitada. Retorna false se ela ja tinha sido visitada ou se faltou memoria.
+static bool PathList_visit(PathList *list, const DirectoryId *id)
+{
+    for (int i = 0; i < list->visited_count; i++)
+        if (list->visited[i].device == id->device && list->visited[i].file == id->file) return false;
+    if (list->visited_count == list->visited_capacity)
+    {
+        int capacity = list->visited_capacity ? list->visited_capacity * 2 : 16;
+        DirectoryId *visited = SDL_realloc(list->visited, capacity * sizeof(list->visited[0]));
+        if (!visited) { list->out_of_memory = true; return false; }
+        list->visited = visited;
+        list->visited_capacity = capacity;
+    }
+    list->visited[list->visited_count++] = *id;
+    return true;
+}
+
+// Adiciona "path" ja na forma canonica. Retorna false apenas se faltar memoria.
+static bool PathList_add(PathList *list, const char *path)
+{
+    if (list->count == list->capacity)
+    {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        char **items = SDL_realloc(list->items, capacity * sizeof(list->items[0]));
+        if (!items) { list->out_of_memory = true; return false; }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count] = canonical_path(path);
+    if (!list->items[list->count]) { list->out_of_memory = true; return false; }
+    list->count++;
+    return true;
+}
+
+static void PathList_destroy(PathList *list)
+{
+    for (int i = 0; i < list->count; i++) SDL_free(list->items[i]);
+    SDL_free(list->items);
+    SDL_free(list->visited);
+    *list = (PathList){ 0 };
+}
+
+static int SDLCALL compare_paths(const void *a, const void *b)
+{
+    return SDL_strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static bool has_image_extension(const char *path)
+{
+    size_t length = SDL_strlen(path);
+    for (size_t i = 0; i < SDL_arraysize(IMAGE_EXTENSIONS); i++)
+    {
+        size_t ext_length = SDL_strlen(IMAGE_EXTENSIONS[i]);
+        if (length > ext_length && SDL_strcasecmp(path + length - ext_length, IMAGE_EXTENSIONS[i]) == 0) return true;
+    }
+    return false;
+}
+
+// Percorre a pasta "path" recursivamente. Uma pasta ilegivel ou ja visitada (ciclo por link
+// simbolico) e registrada no log e ignorada; so a falta de memoria interrompe a listagem.
+static bool collect_directory(PathList *list, const char *path);
+
+static SDL_EnumerationResult SDLCALL collect_directory_entry(void *userdata, const char *dirname, const char *fname)
+{
+    PathList *list = (PathList *)userdata;
+    char *path = NULL;
+    if (SDL_asprintf(&path, "%s%s", dirname, fname) < 0) { list->out_of_memory = true; return SDL_ENUM_FAILURE; }
+
+    SDL_PathInfo info;
+    if (SDL_GetPathInfo(path, &info))
+    {
+        if (info.type == SDL_PATHTYPE_DIRECTORY) collect_directory(list, path);
+        else if (info.type == SDL_PATHTYPE_FILE && has_image_extension(path)) PathList_add(list, path);
+    }
+    SDL_free(path);
+    return list->out_of_memory ? SDL_ENUM_FAILURE : SDL_ENUM_CONTINUE;
+}
+
+static bool collect_directory(PathList *list, const char *path)
+{
+    DirectoryId id;
+    if (!directory_id(path, &id)) { SDL_Log("Nao foi possivel abrir '%s', pasta ignorada.", path); return true; }
+    if (!PathList_visit(list, &id))
+    {
+        if (!list->out_of_memory) SDL_Log("Pasta '%s' ja visitada (link simbolico?), ignorada.", path);
+        return !list->out_of_memory;
+    }
+
+    // Lista pelo caminho real, para que as entradas ja venham sem links simbolicos
+    char *real_path = canonical_path(path);
+    char *dirname = NULL;
+    if (!real_path || SDL_asprintf(&dirname, "%s%s", real_path, real_path[SDL_strlen(real_path) - 1] == '/' ? "" : "/") < 0)
+    {
+        SDL_free(real_path);
+        list->out_of_memory = true;
+        return false;
+    }
+    SDL_free(real_path);
+
+    if (!SDL_EnumerateDirectory(dirname, collect_directory_entry, list) && !list->out_of_memory)
+        SDL_Log("Nao foi possivel listar '%s', pasta ignorada: %s", dirname, SDL_GetError());
+    SDL_free(dirname);
+    return !list->out_of_memory;
+}
+
+// Atualiza (ou cria) o indice com os registros existentes + os arquivos/pastas informados.
+// O novo indice e gravado em "<indice>.tmp" e so entao substitui o anterior.
+static int index_refresh(const char *index_filename, int path_count, char *paths[])
+{
+    ImageIndex old_index;
+    bool has_old = ImageIndex_open(&old_index, index_filename);
+    PathList candidates = { 0 };
+    bool ok = true;
+
+    for (size_t i = 0; ok && has_old && i < old_index.count; i++) ok = PathList_add(&candidates, old_index.records[i].path);
+    for (int i = 0; ok && i < path_count; i++)
+    {
+        char *path = canonical_path(paths[i]);
+        if (!path) { ok = false; break; }
+        SDL_PathInfo info;
+        if (!SDL_GetPathInfo(path, &info)) SDL_Log("Caminho '%s' nao encontrado.", paths[i]);
+        else if (info.type == SDL_PATHTYPE_DIRECTORY) ok = collect_directory(&candidates, path);
+        else ok = PathList_add(&candidates, path);
+        SDL_free(path);
+    }
+    if (!ok) SDL_Log("Memoria insuficiente ao listar arquivos.");
+    SDL_qsort(candidates.items, candidates.count, sizeof(candidates.items[0]), compare_paths);
+
+    char *tmp_filename = NULL;
+    if (ok && SDL_asprintf(&tmp_filename, "%s.tmp", index_filename) < 0) { tmp_filename = NULL; ok = false; }
+    SDL_IOStream *out = ok ? SDL_IOFromFile(tmp_filename, "wb") : NULL;
+    if (ok && !out) { SDL_Log("Erro ao criar '%s': %s", tmp_filename, SDL_GetError()); ok = false; }
+
+    IndexHeader header;
+    SDL_zero(header);
+    SDL_memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.record_size = sizeof(IndexRecord);
+    if (ok) ok = SDL_WriteIO(out, &header, sizeof(header)) == sizeof(header);
+
+    Uint64 reused = 0, decoded = 0;
+    for (int i = 0; ok && i < candidates.count; i++)
+    {
+        const char *path = candidates.items[i];
+        if (i > 0 && SDL_strcmp(path, candidates.items[i - 1]) == 0) continue;
+
+        SDL_PathInfo info;
+        if (!SDL_GetPathInfo(path, &info) || info.type != SDL_PATHTYPE_FILE) continue; // Removido do disco
+        if (SDL_strlen(path) >= INDEX_PATH_SIZE) { SDL_Log("Caminho muito longo, ignorado: '%s'", path); continue; }
+
+        IndexRecord record;
+        const IndexRecord *old = has_old ? ImageIndex_find(&old_index, path) : NULL;
+        if (old && IndexRecord_matches(old, &info)) { record = *old; reused++; }
+        else if (IndexRecord_compute(&record, path, &info)) { decoded++; SDL_Log("Indexado: %s", path); }
+        else continue;
+
+        ok = SDL_WriteIO(out, &record, sizeof(record)) == sizeof(record);
+        header.count++;
+    }
+
+    if (ok) ok = SDL_SeekIO(out, 0, SDL_IO_SEEK_SET) == 0 && SDL_WriteIO(out, &header, sizeof(header)) == sizeof(header);
+    if (out && !SDL_CloseIO(out)) ok = false;
+    if (has_old) ImageIndex_close(&old_index); // O arquivo precisa estar desmapeado antes de ser substituido
+    if (ok) ok = SDL_RenamePath(tmp_filename, index_filename);
+    if (!ok)
+    {
+        SDL_Log("Erro ao gravar o indice '%s': %s", index_filename, SDL_GetError());
+        if (out) SDL_RemovePath(tmp_filename);
+    }
+    else
+    {
+        SDL_Log("Indice '%s': %llu imagens (%llu reaproveitadas, %llu decodificadas).", index_filename,
+                (unsigned long long)header.count, (unsigned long long)reused, (unsigned long long)decoded);
+    }
+
+    SDL_free(tmp_filename);
+    PathList_destroy(&candidates);
+    return ok ? 0 : SDL_APP_FAILURE;
+}
+
+// Lista as imagens cuja classificacao de intensidade (CI) ou contraste (CC) e "classification".
+static int index_query(const char *index_filename, const char *field, const char *classification)
+{
+    bool by_intensity = SDL_strcasecmp(field, "CI") == 0;
+    if (!by_intensity && SDL_strcasecmp(field, "CC") != 0)
+    {
+        SDL_Log("Campo '%s' invalido, use CI ou CC.", field);
+        return SDL_APP_FAILURE;
+    }
+
+    ImageIndex index;
+    if (!ImageIndex_open(&index, index_filename)) { SDL_Log("Nao foi possivel abrir o indice '%s'.", index_filename); return SDL_APP_FAILURE; }
+
+    size_t matches = 0;
+    for (size_t i = 0; i < index.count; i++)
+    {
+        const IndexRecord *record = &index.records[i];
+        const char *class_name = by_intensity ? classify_intensity_string((int)roundf(record->average_intensity))
+                                              : classify_deviation_string(record->std_deviation);
+        if (SDL_strcasecmp(class_name, classification) != 0) continue;
+        printf("%s\tMD: %.2f\tDP: %.2f\n", record->path, record->average_intensity, record->std_deviation);
+        matches++;
+    }
+    SDL_Log("%llu de %llu imagens com %s = %s.", (unsigned long long)matches, (unsigned long long)index.count, by_intensity ? "CI" : "CC", classification);
+
+    ImageIndex_close(&index);
+    return 0;
+}
+
+// Distancia L1 entre histogramas normalizados (0 = identicos, 2 * INDEX_HISTOGRAM_SCALE = disjuntos)
+static Uint32 histogram_distance(const Uint16 a[256], const Uint16 b[256])
+{
+    Uint32 distance = 0;
+    for (int i = 0; i < 256; i++) distance += (Uint32)(a[i] > b[i] ? a[i] - b[i] : b[i] - a[i]);
+    return distance;
+}
+
+// Lista as k imagens do indice com histograma mais proximo ao de "image_filename".
+static int index_nearest(const char *index_filename, const char *image_filename, int k)
+{
+    if (k < 1) k = INDEX_DEFAULT_NEAREST;
+    if (k > INDEX_MAX_NEAREST) k = INDEX_MAX_NEAREST;
+
+    SDL_PathInfo info;
+    if (!SDL_GetPathInfo(image_filename, &info) || info.type != SDL_PATHTYPE_FILE)
+    {
+        SDL_Log("Imagem '%s' nao encontrada.", image_filename);
+        return SDL_APP_FAILURE;
+    }
+
+    ImageIndex index;
+    if (!ImageIndex_open(&index, index_filename)) { SDL_Log("Nao foi possivel abrir o indice '%s'.", index_filename); return SDL_APP_FAILURE; }
+
+    // Usa a assinatura do indice quando estiver atualizada; senao decodifica a imagem.
+    // O caminho canonico tambem identifica a propria imagem na lista de resultados.
+    char *path = canonical_path(image_filename);
+    if (!path) { ImageIndex_close(&index); return SDL_APP_FAILURE; }
+    IndexRecord target;
+    const IndexRecord *found = ImageIndex_find(&index, path);
+    bool ok = true;
+    if (found && IndexRecord_matches(found, &info)) target = *found;
+    else ok = IndexRecord_compute(&target, path, &info);
+    SDL_free(path);
+    if (!ok) { ImageIndex_close(&index); return SDL_APP_FAILURE; }
+
+    const IndexRecord *best[INDEX_MAX_NEAREST];
+    Uint32 best_distance[INDEX_MAX_NEAREST];
+    int best_count = 0;
+    for (size_t i = 0; i < index.count; i++)
+    {
+        const IndexRecord *record = &index.records[i];
+        if (SDL_strcmp(record->path, target.path) == 0) continue;
+        Uint32 distance = histogram_distance(target.histogram, record->histogram);
+        if (best_count == k && distance >= best_distance[k - 1]) continue;
+
+        // Insercao ordenada nos k melhores
+        int pos = best_count < k ? best_count++ : k - 1;
+        while (pos > 0 && best_distance[pos - 1] > distance)
+        {
+            best[pos] = best[pos - 1];
+            best_distance[pos] = best_distance[pos - 1];
+            pos--;
+        }
+        best[pos] = record;
+        best_distance[pos] = distance;
+    }
+
+    for (int i = 0; i < best_count; i++)
+        printf("%.4f\t%s\n", best_distance[i] / (2.0 * INDEX_HISTOGRAM_SCALE), best[i]->path);
+
+    ImageIndex_close(&index);
+    return 0;
 }
 
 //------------------------------------------------------------------------------
 // main()
 //------------------------------------------------------------------------------
+static void print_usage(const char *program)
+{
+    SDL_Log("Uso: %s <arquivo_imagem>", program);
+    SDL_Log("     %s --index <indice> [arquivos/pastas ...]", program);
+    SDL_Log("     %s --query <indice> CI|CC <classificacao>", program);
+    SDL_Log("     %s --nearest <indice> <arquivo_imagem> [k]", program);
+}
+
 int main(int argc, char *argv[])
 {
     atexit(shutdown);
     if (argc < 2) {
-        SDL_Log("Uso: %s <arquivo_imagem>", argv[0]);
+        print_usage(argv[0]);
         return SDL_APP_FAILURE;
     }
+
+    // Modos de linha de comando do indice (sem janelas); com argumentos faltando nao caem no modo grafico
+    if (SDL_strcmp(argv[1], "--index") == 0)
+    {
+        if (argc < 3) { print_usage(argv[0]); return SDL_APP_FAILURE; }
+        return index_refresh(argv[2], argc - 3, argv + 3);
+    }
+    if (SDL_strcmp(argv[1], "--query") == 0)
+    {
+        if (argc < 5) { print_usage(argv[0]); return SDL_APP_FAILURE; }
+        return index_query(argv[2], argv[3], argv[4]);
+    }
+    if (SDL_strcmp(argv[1], "--nearest") == 0)
+    {
+        if (argc < 4) { print_usage(argv[0]); return SDL_APP_FAILURE; }
+        return index_nearest(argv[2], argv[3], argc >= 5 ? SDL_atoi(argv[4]) : INDEX_DEFAULT_NEAREST);
+    }
     if (initialize() == SDL_APP_FAILURE) return SDL_APP_FAILURE;
 
     g_font = TTF_OpenFont(FONT_FILENAME, FONT_SIZE);
@@ -617,15 +1803,12 @@ int main(int argc, char *argv[])
         return SDL_APP_FAILURE;
     }
 
+    // A decodificacao fica na thread principal: o tamanho da janela depende da imagem
     load_rgba32(argv[1], g_window.renderer, &g_image, &g_image_two);
+    if (!g_image_two.surface) return SDL_APP_FAILURE;
 
-    // Converte a imagem principal para tons de cinza
-    if(verify_gray_scale(g_window.renderer, &g_image) == 0) to_gray_scale(g_window.renderer, &g_image);
-    
-    SDL_memcpy(g_image_two.surface->pixels, g_image.surface->pixels, g_image.surface->h * g_image.surface->pitch);
-    
-    // Calcula o histograma inicial (da imagem em tons de cinza)
-    calculate_histogram();
+    // Converte para tons de cinza e calcula o histograma inicial em segundo plano
+    request_image_state(false);
 
     h_button.rect = (SDL_FRect){ .x = 300, .y = DEFAULT_H_WINDOW_HEIGHT - 100, .w = 190, .h = 35 };
     h_button.normal = (SDL_Color){0, 0, 200, 255};